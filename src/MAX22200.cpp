@@ -106,11 +106,68 @@ bool MAX22200::ChannelConfig::hitCurrentCheckEnabled() const {
     return (bits & _BV(MAX22200_HHF_EN)) != 0;
 }
 
+void MAX22200::DPMConfig::setStartCurrent(uint8_t level) {
+    level >>= 1; //reduce to 7-bits
+    bits &= ~((uint32_t) 0x7Fu << MAX22200_DPM_ISTART);
+    bits |= (uint32_t) level << MAX22200_DPM_ISTART;
+}
+
+uint8_t MAX22200::DPMConfig::startCurrent() const {
+    return ((bits >> MAX22200_DPM_ISTART) & 0x7Fu) << 1;
+}
+
+void MAX22200::DPMConfig::setThreshold(uint8_t threshold) {
+    bits &= ~((uint32_t) 0xFu << MAX22200_DPM_IPTH);
+    bits |= (uint32_t) (threshold & 0xFu) << MAX22200_DPM_IPTH;
+}
+
+uint8_t MAX22200::DPMConfig::threshold() const {
+    return (bits >> MAX22200_DPM_IPTH) & 0xFu;
+}
+
+void MAX22200::DPMConfig::setDebounce(uint8_t periods) {
+    bits &= ~((uint32_t) 0xFu << MAX22200_DPM_TDEB);
+    bits |= (uint32_t) (periods & 0xFu) << MAX22200_DPM_TDEB;
+}
+
+uint8_t MAX22200::DPMConfig::debounce() const {
+    return (bits >> MAX22200_DPM_TDEB) & 0xFu;
+}
+
 MAX22200::MAX22200(uint8_t en, uint8_t csb, uint8_t cmd) {
     //set pins
     pin_en = en;
     pin_csb = csb;
     pin_cmd = cmd;    
+
+    status = 0;
+
+    idle_timeout = 0;
+    idle_since = 0;
+    wakeup_time = MAX22200_DEFAULT_WAKEUP_US;
+    trigger_channels = 0;
+
+    dpm_channels = 0;
+    dpm_enabled = 0;
+    dpm_pending = 0;
+    dpm_window = 0;
+    dpm_backoff = MAX22200_DPM_POLL_MIN_US;
+    dpm_poll_at = 0;
+
+    wave_steps = 0;
+    wave_length = 0;
+    wave_loop = false;
+    wave_next_steps = 0;
+    wave_next_length = 0;
+    wave_next_loop = false;
+    wave_index = 0;
+    wave_remaining = 0;
+    wave_frames = 0;
+    wave_skipped = 0;
+    wave_tick = MAX22200_DEFAULT_WAVEFORM_TICK_US;
+    wave_last_tick = 0;
+    wave_rate_frames = 0;
+    wave_rate_time = 0;
 }
 
 void MAX22200::beginTransaction() {
@@ -207,6 +264,8 @@ void MAX22200::begin(
     status |= _BV(MAX22200_FREQM); //set max frequency to 80khz
     setChannelModes(cm10, cm32, cm54, cm76);
 
+    idle_since = millis();
+
 }
 
 void MAX22200::setChannelModes(
@@ -214,6 +273,8 @@ void MAX22200::setChannelModes(
     MAX22200::ChannelMode cm54, MAX22200::ChannelMode cm76
 ) {
 
+    noInterrupts();
+
     //clear prev config
     const uint32_t mask = 0xFFu << MAX22200_CM10;
     status &= ~mask;
@@ -224,6 +285,8 @@ void MAX22200::setChannelModes(
     status |= (uint32_t) cm76 << MAX22200_CM76;
 
     write32(MAX22200_STATUS, status);
+
+    interrupts();
 }
 
 //TODO: lol
@@ -231,6 +294,8 @@ void MAX22200::setChannelMode(uint8_t ch, ChannelMode mode) {
     //round down to the nearest even number
     ch &= ~1u;
 
+    noInterrupts();
+
     //delete the prev mode
     uint32_t mask = 0b11u << (ch+MAX22200_CM10);
     status &= ~mask;
@@ -238,6 +303,8 @@ void MAX22200::setChannelMode(uint8_t ch, ChannelMode mode) {
     //update the mode
     status |= (uint32_t) mode << (ch+MAX22200_CM10);
     write32(MAX22200_STATUS, status);
+
+    interrupts();
 }
 
 MAX22200::ChannelMode MAX22200::getChannelMode(uint8_t ch) {
@@ -252,6 +319,33 @@ uint8_t MAX22200::getChannels() {
 }
 
 void MAX22200::writeChannels(uint8_t out) {
+    //the outputs can't be driven in low-power mode
+    if(out && !isActive()) {
+        uint32_t start = micros();
+        activate();
+
+        uint32_t latency = micros() - start;
+        power_stats.wakes++;
+        power_stats.lastWakeLatency = latency;
+        power_stats.totalWakeLatency += latency;
+        if(latency > power_stats.maxWakeLatency) power_stats.maxWakeLatency = latency;
+    }
+
+    //restart the idle timer when the last channel turns off
+    if(!out && getChannels()) idle_since = millis();
+
+    uint8_t rising = out & ~getChannels() & dpm_channels & dpm_enabled;
+
+    //keep a waveform interrupt from writing ONCH in between
+    noInterrupts();
+    writeONCH(out);
+    interrupts();
+
+    //start timing any watched channel that is turning on
+    if(rising) startDPMMonitor(rising);
+}
+
+void MAX22200::writeONCH(uint8_t out) {
     status &= 0x00FFFFFFu;
     status |= (uint32_t) out << MAX22200_ONCH;
     write8(MAX22200_STATUS, out);
@@ -272,9 +366,332 @@ bool MAX22200::toggleChannel(uint8_t ch) {
 }
 
 void MAX22200::configChannel(uint8_t ch, MAX22200::ChannelConfig cfg) {
+    //remember which channels are driven by the trigger pins for the idle policy
+    SET_BITS(trigger_channels, _BV(ch), cfg.usesTriggerPin());
+
+    //and which ones can report a DPM fault for the monitor
+    SET_BITS(dpm_enabled, _BV(ch), cfg.detectionOfPlungerMovementEnabled());
+    dpm_pending &= dpm_enabled;
+
+    //they can be switched on at any time, so make sure the IC is ready for them
+    if(trigger_channels) wake();
+
     write32(MAX22200_CFG_CH1+ch, cfg.bits);
 }
 
 MAX22200::ChannelConfig MAX22200::readChannelConfig(uint8_t ch) {
     return ChannelConfig(read32(MAX22200_CFG_CH1+ch));
 }
+
+bool MAX22200::isActive() {
+    return (status & _BV(MAX22200_ACTIVE)) != 0;
+}
+
+void MAX22200::sleep() {
+    if(!isActive()) return;
+
+    noInterrupts();
+    status &= ~(uint32_t) _BV(MAX22200_ACTIVE);
+    write32(MAX22200_STATUS, status);
+    interrupts();
+
+    power_stats.sleeps++;
+}
+
+void MAX22200::wake() {
+    if(isActive()) return;
+
+    activate();
+    power_stats.otherWakes++;
+}
+
+void MAX22200::activate() {
+    noInterrupts();
+    status |= _BV(MAX22200_ACTIVE);
+    write32(MAX22200_STATUS, status);
+    interrupts();
+
+    delayMicroseconds(wakeup_time);
+
+    idle_since = millis();
+}
+
+void MAX22200::setIdleTimeout(uint32_t ms) {
+    idle_timeout = ms;
+    idle_since = millis();
+}
+
+uint32_t MAX22200::idleTimeout() {
+    return idle_timeout;
+}
+
+void MAX22200::setWakeupTime(uint16_t us) {
+    wakeup_time = us;
+}
+
+uint16_t MAX22200::wakeupTime() {
+    return wakeup_time;
+}
+
+const MAX22200::PowerStats& MAX22200::powerStats() {
+    return power_stats;
+}
+
+void MAX22200::resetPowerStats() {
+    power_stats = PowerStats();
+}
+
+void MAX22200::update() {
+    //catch up on any waveform ticks that are due
+    if(wave_tick && wave_steps) {
+        uint32_t ticks = (micros() - wave_last_tick) / wave_tick;
+        if(ticks) {
+            wave_last_tick += ticks * wave_tick;
+            advanceWaveform(ticks);
+        }
+    }
+
+    //an all-off step of a waveform doesn't count as idle
+    if(waveformPlaying()) idle_since = millis();
+
+    //go to sleep if nothing has been on for long enough
+    if(idle_timeout && isActive() && !getChannels() && !trigger_channels && !waveformPlaying()) {
+        if(millis() - idle_since >= idle_timeout) sleep();
+    }
+
+    //check on any actuations that haven't settled yet
+    if(dpm_pending && (int32_t) (micros() - dpm_poll_at) >= 0) pollDPMMonitor();
+}
+
+void MAX22200::configDPM(MAX22200::DPMConfig cfg) {
+    write32(MAX22200_CFG_DPM, cfg.bits);
+}
+
+MAX22200::DPMConfig MAX22200::readDPMConfig() {
+    return DPMConfig(read32(MAX22200_CFG_DPM));
+}
+
+void MAX22200::setDPMMonitor(uint8_t channels, uint32_t window_us) {
+    dpm_channels = channels;
+    dpm_window = window_us;
+    dpm_pending &= channels;
+}
+
+uint8_t MAX22200::dpmMonitorChannels() {
+    return dpm_channels;
+}
+
+bool MAX22200::dpmPending(uint8_t ch) {
+    return (dpm_pending & _BV(ch)) != 0;
+}
+
+const MAX22200::DPMStats& MAX22200::dpmStats(uint8_t ch) {
+    return dpm_stats[ch];
+}
+
+void MAX22200::resetDPMStats() {
+    for(uint8_t ch=0; ch<8; ch++) dpm_stats[ch] = DPMStats();
+}
+
+void MAX22200::startDPMMonitor(uint8_t rising) {
+    //FAULT is latched, so read it now to clear anything left over from
+    //earlier, settling the channels already being watched along the way
+    uint32_t faults = read32(MAX22200_FAULT);
+    uint32_t now = micros();
+    if(dpm_pending) settleDPMMonitor(faults, now);
+
+    for(uint8_t ch=0; ch<8; ch++) {
+        if(rising & _BV(ch)) dpm_start[ch] = now;
+    }
+    dpm_pending |= rising;
+
+    //a fresh actuation needs fast polling again
+    dpm_backoff = MAX22200_DPM_POLL_MIN_US;
+    settleDPMMonitor(0, now);
+}
+
+void MAX22200::pollDPMMonitor() {
+    uint32_t faults = read32(MAX22200_FAULT);
+
+    //nothing changed, so wait a little longer next time
+    if(dpm_backoff < MAX22200_DPM_POLL_MAX_US) dpm_backoff <<= 1;
+    if(dpm_backoff > MAX22200_DPM_POLL_MAX_US) dpm_backoff = MAX22200_DPM_POLL_MAX_US;
+
+    settleDPMMonitor(faults, micros());
+}
+
+void MAX22200::settleDPMMonitor(uint32_t faults, uint32_t now) {
+    uint32_t next = dpm_backoff;
+
+    //give the IC a moment to latch a fault from the very end of the HIT phase
+    uint32_t deadline = dpm_window + MAX22200_DPM_SETTLE_US;
+
+    for(uint8_t ch=0; ch<8; ch++) {
+        if(!(dpm_pending & _BV(ch))) continue;
+
+        uint32_t elapsed = now - dpm_start[ch];
+        if(faults & _BV(ch+MAX22200_FAULT_DPM)) {
+            recordDPMOutcome(ch, false);
+        } else if(!getChannel(ch)) {
+            //turned off before the IC could judge it, so there's nothing to record
+            dpm_pending &= ~_BV(ch);
+        } else if(elapsed >= deadline) {
+            recordDPMOutcome(ch, true);
+        } else if(deadline - elapsed < next) {
+            //don't poll past the end of this channel's window
+            next = deadline - elapsed;
+        }
+    }
+
+    dpm_poll_at = now + next;
+}
+
+void MAX22200::recordDPMOutcome(uint8_t ch, bool moved) {
+    dpm_pending &= ~_BV(ch);
+
+    DPMStats& stats = dpm_stats[ch];
+    if(moved) stats.moved++; else stats.failed++;
+    stats.lastMoved = moved;
+}
+
+void MAX22200::playWaveform(const WaveformStep* steps, uint16_t length, bool loop) {
+    stopWaveform();
+    startWaveform(steps, length, loop);
+}
+
+void MAX22200::queueWaveform(const WaveformStep* steps, uint16_t length, bool loop) {
+    if(!steps || !length) return;
+
+    noInterrupts();
+    bool playing = wave_steps != 0;
+    if(playing) {
+        wave_next_steps = steps;
+        wave_next_length = length;
+        wave_next_loop = loop;
+    }
+    interrupts();
+
+    if(!playing) startWaveform(steps, length, loop);
+}
+
+void MAX22200::stopWaveform() {
+    noInterrupts();
+    wave_steps = 0;
+    wave_next_steps = 0;
+    interrupts();
+}
+
+bool MAX22200::waveformPlaying() {
+    return wave_steps != 0;
+}
+
+void MAX22200::setWaveformTickMicros(uint32_t us) {
+    wave_tick = us;
+    wave_last_tick = micros();
+}
+
+uint32_t MAX22200::waveformTickMicros() {
+    return wave_tick;
+}
+
+void MAX22200::startWaveform(const WaveformStep* steps, uint16_t length, bool loop) {
+    if(!steps || !length) return;
+
+    //playback skips the wake-up in writeChannels()
+    wake();
+
+    //nothing is playing yet, so none of this can race the interrupt
+    wave_length = length;
+    wave_loop = loop;
+    wave_index = 0;
+    wave_remaining = steps[0].ticks ? steps[0].ticks : 1;
+
+    writeONCH(steps[0].channels);
+
+    noInterrupts();
+    wave_frames++;
+    wave_rate_frames = wave_frames;
+    interrupts();
+
+    wave_rate_time = wave_last_tick = micros();
+
+    //hand it over to the interrupt
+    noInterrupts();
+    wave_steps = steps;
+    interrupts();
+}
+
+void MAX22200::waveformTick() {
+    advanceWaveform(1);
+}
+
+void MAX22200::advanceWaveform(uint32_t ticks) {
+    if(!wave_steps) return;
+
+    uint32_t entered = 0;
+    bool ended = false;
+
+    //skip over every step the ticks cover, but only write the last one
+    while(ticks >= wave_remaining) {
+        ticks -= wave_remaining;
+
+        if(++wave_index >= wave_length) {
+            //swap in the queued waveform at the end of this pass
+            if(wave_next_steps) {
+                wave_steps = wave_next_steps;
+                wave_length = wave_next_length;
+                wave_loop = wave_next_loop;
+                wave_next_steps = 0;
+            } else if(!wave_loop) {
+                wave_index--;
+                ended = true;
+                break;
+            }
+            wave_index = 0;
+        }
+
+        const WaveformStep& step = wave_steps[wave_index];
+        wave_remaining = step.ticks ? step.ticks : 1;
+        entered++;
+    }
+
+    if(!ended) wave_remaining -= ticks;
+
+    if(entered) {
+        writeONCH(wave_steps[wave_index].channels);
+        wave_frames++;
+
+        //every step passed over on the way never made it to the outputs
+        wave_skipped += entered - 1;
+    }
+
+    if(ended) wave_steps = 0;
+}
+
+uint32_t MAX22200::waveformFrames() {
+    noInterrupts();
+    uint32_t frames = wave_frames;
+    interrupts();
+    return frames;
+}
+
+uint32_t MAX22200::waveformSkippedSteps() {
+    noInterrupts();
+    uint32_t skipped = wave_skipped;
+    interrupts();
+    return skipped;
+}
+
+float MAX22200::waveformFramesPerSecond() {
+    uint32_t frames = waveformFrames();
+    uint32_t now = micros();
+
+    //only measure since the last call so that the rate stays current
+    uint32_t count = frames - wave_rate_frames;
+    uint32_t elapsed = now - wave_rate_time;
+    wave_rate_frames = frames;
+    wave_rate_time = now;
+
+    if(!elapsed) return 0;
+    return (float) count * 1e6f / (float) elapsed;
+}
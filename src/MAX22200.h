@@ -3,6 +3,19 @@
 
 #include <stdint.h>
 
+//Time the IC needs after ACTIVE is set before the outputs can be driven
+#define MAX22200_DEFAULT_WAKEUP_US 500
+
+//Bounds of the back-off used when polling FAULT for plunger movement
+#define MAX22200_DPM_POLL_MIN_US 250
+#define MAX22200_DPM_POLL_MAX_US 8000
+
+//Extra time allowed after the DPM window for the IC to latch its fault
+#define MAX22200_DPM_SETTLE_US 500
+
+//Default tick period of the waveform engine when it is driven by update()
+#define MAX22200_DEFAULT_WAVEFORM_TICK_US 1000
+
 class MAX22200 {
 
 public:
@@ -250,6 +263,94 @@ public:
 
     };
 
+    struct DPMConfig {
+
+        uint32_t bits;
+        inline DPMConfig(): bits(0) {}
+
+        //
+        //Sets the current at which the IC starts looking for the dip caused
+        //by the plunger moving. Ranges from 0-255 as a proportion of full-scale,
+        //and like the HIT level, only the upper 7 bits are used in practice.
+        //The default value is 0.
+        //
+        void setStartCurrent(uint8_t level);
+        inline DPMConfig withStartCurrent(uint8_t level) { setStartCurrent(level); return *this; }
+
+        uint8_t startCurrent() const;
+
+        //
+        //Sets how deep the current dip has to be to count as plunger movement.
+        //Ranges from 0-15.
+        //The default value is 0.
+        //
+        void setThreshold(uint8_t threshold);
+        inline DPMConfig withThreshold(uint8_t threshold) { setThreshold(threshold); return *this; }
+
+        uint8_t threshold() const;
+
+        //
+        //Sets how long the dip has to last to count as plunger movement,
+        //in chopping periods. Ranges from 0-15.
+        //The default value is 0.
+        //
+        void setDebounce(uint8_t periods);
+        inline DPMConfig withDebounce(uint8_t periods) { setDebounce(periods); return *this; }
+
+        uint8_t debounce() const;
+
+        private:
+          inline DPMConfig(uint32_t bits): bits(bits) {}
+          friend class MAX22200;
+
+    };
+
+    //
+    //Outcomes recorded by the DPM monitor for a single channel.
+    //The IC only flags a DPM fault at the end of the HIT phase and never
+    //reports when the plunger actually moved, so only whether it moved
+    //is recorded, not how long it took.
+    //
+    struct DPMStats {
+        uint32_t moved;
+        uint32_t failed;
+        bool lastMoved;
+
+        inline DPMStats(): moved(0), failed(0), lastMoved(false) {}
+    };
+
+    //
+    //One run of a run-length encoded waveform: the ONCH byte to output,
+    //and how many ticks of the waveform engine to hold it for.
+    //A duration of 0 is treated as 1 tick.
+    //
+    struct WaveformStep {
+        uint8_t channels;
+        uint16_t ticks;
+    };
+
+    //
+    //Counters for the automatic low-power policy.
+    //wakes only counts the wake-ups done by a channel write, and the latencies
+    //are the microseconds each of those added in front of that write.
+    //Wake-ups from wake(), configChannel() or the start of a waveform
+    //are counted in otherWakes and don't affect the latencies.
+    //
+    struct PowerStats {
+        uint32_t sleeps;
+        uint32_t wakes;
+        uint32_t otherWakes;
+        uint32_t lastWakeLatency;
+        uint32_t maxWakeLatency;
+        uint32_t totalWakeLatency;
+
+        inline PowerStats(): sleeps(0), wakes(0), otherWakes(0), lastWakeLatency(0), maxWakeLatency(0), totalWakeLatency(0) {}
+
+        inline uint32_t averageWakeLatency() const {
+            return wakes ? totalWakeLatency / wakes : 0;
+        }
+    };
+
 
 private:
 
@@ -260,6 +361,47 @@ private:
 
     uint32_t status;
 
+    void writeONCH(uint8_t out);
+    void activate();
+
+    uint32_t idle_timeout; //ms, 0 if the idle policy is disabled
+    uint32_t idle_since;   //millis() at the moment ONCH last became zero
+    uint16_t wakeup_time;  //us
+    uint8_t  trigger_channels; //channels configured for TRIGA/TRIGB control
+    PowerStats power_stats;
+
+    uint8_t  dpm_channels; //channels watched by the DPM monitor
+    uint8_t  dpm_enabled;  //channels configured with DPM_EN
+    uint8_t  dpm_pending;  //channels still waiting on an outcome
+    uint32_t dpm_window;   //us
+    uint32_t dpm_backoff;  //us
+    uint32_t dpm_poll_at;  //micros() of the next FAULT poll
+    uint32_t dpm_start[8];
+    DPMStats dpm_stats[8];
+
+    const WaveformStep* volatile wave_steps;
+    volatile uint16_t wave_length;
+    volatile bool wave_loop;
+    const WaveformStep* volatile wave_next_steps;
+    volatile uint16_t wave_next_length;
+    volatile bool wave_next_loop;
+    volatile uint16_t wave_index;
+    volatile uint16_t wave_remaining;
+    volatile uint32_t wave_frames;
+    volatile uint32_t wave_skipped;
+    uint32_t wave_tick;     //us, 0 if ticked externally
+    uint32_t wave_last_tick;
+    uint32_t wave_rate_frames; //wave_frames at the last rate measurement
+    uint32_t wave_rate_time;   //micros() at the last rate measurement
+
+    void startWaveform(const WaveformStep* steps, uint16_t length, bool loop);
+    void advanceWaveform(uint32_t ticks);
+
+    void startDPMMonitor(uint8_t rising);
+    void pollDPMMonitor();
+    void settleDPMMonitor(uint32_t faults, uint32_t now);
+    void recordDPMOutcome(uint8_t ch, bool moved);
+
     void beginTransaction();
     void endTransaction();
 
@@ -298,6 +440,132 @@ public:
     void configChannel(uint8_t ch, ChannelConfig cfg);
     ChannelConfig readChannelConfig(uint8_t ch);
 
+    void configDPM(DPMConfig cfg);
+    DPMConfig readDPMConfig();
+
+    //
+    //Watches the given channels for plunger movement. Every time one of them
+    //is turned on over SPI, update() polls the FAULT register, backing off
+    //from MAX22200_DPM_POLL_MIN_US up to MAX22200_DPM_POLL_MAX_US, until
+    //either a DPM fault shows up or window_us has passed without one.
+    //The window should cover the channel's HIT time, and a further
+    //MAX22200_DPM_SETTLE_US is allowed after it for the fault to latch.
+    //Only channels given DPM_EN through configChannel() are timed, and
+    //configDPM() has to have been called for the IC to detect anything.
+    //FAULT is also read on each activation to clear any fault left over
+    //from before it, so the result only reflects the new actuation.
+    //Note that reading FAULT clears it, so other faults reported there
+    //will be missed while the monitor is running.
+    //A mask of 0 disables the monitor.
+    //
+    void setDPMMonitor(uint8_t channels, uint32_t window_us);
+    inline void disableDPMMonitor() { setDPMMonitor(0, dpm_window); }
+    uint8_t dpmMonitorChannels();
+
+    bool dpmPending(uint8_t ch);
+    const DPMStats& dpmStats(uint8_t ch);
+    void resetDPMStats();
+
+    //
+    //Plays back a sequence of ONCH values, each held for a number of ticks,
+    //through the single-byte channel write. The first step is output immediately.
+    //If loop is set the sequence repeats until stopped or replaced.
+    //The steps are not copied, so they must stay valid while playing.
+    //
+    //Playback writes ONCH directly, skipping the wake-up and DPM monitor
+    //hooks of writeChannels(). Instead the IC is woken before the first step,
+    //and the idle policy is held off for as long as a waveform is loaded.
+    //
+    void playWaveform(const WaveformStep* steps, uint16_t length, bool loop);
+
+    //
+    //Queues a waveform to take over once the current one reaches its last step,
+    //so that the swap happens on a step boundary without any gap. Starts it
+    //immediately if nothing is playing.
+    //
+    void queueWaveform(const WaveformStep* steps, uint16_t length, bool loop);
+
+    //
+    //Stops playback and drops any queued waveform. The outputs are left as they are.
+    //
+    void stopWaveform();
+    bool waveformPlaying();
+
+    //
+    //Sets the tick period used when playback is driven from update().
+    //This mode is only as steady as loop(): if it falls behind, the missed
+    //ticks are skipped over, only the step playback has arrived at gets
+    //written, and any steps passed over are counted in waveformSkippedSteps().
+    //Calling waveformTick() from a timer interrupt is the supported way to
+    //get jitter-free playback. Set this to 0 when doing so,
+    //in which case SPI.usingInterrupt() should be used so that other
+    //transfers from loop() aren't interrupted mid-transaction.
+    //The default is MAX22200_DEFAULT_WAVEFORM_TICK_US.
+    //
+    //While an interrupt is driving playback, loop() can safely call update(),
+    //the getters, the waveform controls and the stats functions.
+    //writeChannels() and the other STATUS writers mask interrupts while they
+    //update the register, so they won't corrupt playback, but any channels
+    //they set will be overwritten by the next step.
+    //
+    void setWaveformTickMicros(uint32_t us);
+    uint32_t waveformTickMicros();
+
+    //
+    //Advances playback by a single tick.
+    //
+    void waveformTick();
+
+    //
+    //Total number of ONCH frames written by the waveform engine,
+    //and the rate they were written at since the last call to
+    //waveformFramesPerSecond() or the start of playback.
+    //
+    uint32_t waveformFrames();
+    float waveformFramesPerSecond();
+
+    //
+    //Total number of steps that were never written because playback
+    //had already moved past them by the time it caught up.
+    //
+    uint32_t waveformSkippedSteps();
+
+    //
+    //Clears or sets the ACTIVE bit to put the IC in or out of low-power mode.
+    //wake() blocks for the wake-up time so that the outputs can be driven
+    //as soon as it returns. Both do nothing if already in the requested state.
+    //
+    void sleep();
+    void wake();
+    bool isActive();
+
+    //
+    //Puts the IC into low-power mode once every channel has been off for
+    //the given number of milliseconds. The next write that turns a channel
+    //on wakes the IC up again automatically. A value of 0 disables the policy.
+    //The IC is kept awake while any channel is set to use the trigger pins
+    //through configChannel(), since those don't show up in ONCH.
+    //The timeout is only checked from update().
+    //The default is 0 (disabled).
+    //
+    void setIdleTimeout(uint32_t ms);
+    uint32_t idleTimeout();
+
+    //
+    //Sets how long wake() waits after setting ACTIVE before returning.
+    //The default is MAX22200_DEFAULT_WAKEUP_US.
+    //
+    void setWakeupTime(uint16_t us);
+    uint16_t wakeupTime();
+
+    const PowerStats& powerStats();
+    void resetPowerStats();
+
+    //
+    //Runs the background housekeeping. Should be called regularly from loop().
+    //
+    void update();
+
 };
 
 #endif //MAX22200_H
@@ -112,8 +112,8 @@
 //CFG_DPM register bits
 //
 
-#define MAX22200_DPM_IPTH    0
-#define MAX22200_DPM_TDEB    4 //
+#define MAX22200_DPM_IPTH    0 //Current dip threshold for detecting movement
+#define MAX22200_DPM_TDEB    4 //Debounce time of the current dip, in chopping periods
 #define MAX22200_DPM_ISTART  8 //DPM starting current
 
 #endif //MAX22200_REGISTERS_H
\ No newline at end of file